@@ -0,0 +1,228 @@
+#include "cpu-sandpile.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace sandbox
+{
+  namespace
+  {
+    CpuSandpile::Config clampConfig(CpuSandpile::Config config, size_t dim)
+    {
+      config.threads = std::max<size_t>(1, std::min(config.threads, dim));
+      config.tileWidth = std::max<size_t>(1, std::min(config.tileWidth, dim));
+      // Neighbouring bands must be at least as tall as the halo they supply
+      config.blockDepth = std::max<size_t>(1, std::min(config.blockDepth, dim / config.threads));
+      return config;
+    }
+  }
+
+  void Barrier::arriveAndWait()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    size_t generation = m_generation;
+    if (++m_arrived == m_count)
+    {
+      m_arrived = 0;
+      m_generation++;
+      m_released.notify_all();
+      return;
+    }
+    m_released.wait(lock, [&] { return m_generation != generation; });
+  }
+
+  CpuSandpile::Config CpuSandpile::defaultConfig(const Topology& topology, size_t dim)
+  {
+    return { topology.processorCount(), dim, 1 };
+  }
+
+  CpuSandpile::CpuSandpile(const log::Target& logTarget, const Topology& topology, size_t dim,
+    const std::vector<uint32_t>& initialSand, const Config& config):
+    m_log(logTarget, "CpuSandpile"), m_topology(topology), m_dim(dim), m_config(clampConfig(config, dim)),
+    m_frameBarrier(m_config.threads + 1), m_passBarrier(m_config.threads)
+  {
+    size_t threads = m_config.threads;
+    std::vector<Placement> placements = topology.place(threads);
+    for (size_t i = 0; i < threads; i++)
+    {
+      size_t firstRow = dim * i / threads;
+      m_bands.push_back({ firstRow, dim * (i + 1) / threads - firstRow, placements[i], { nullptr, nullptr } });
+    }
+
+    for (size_t i = 0; i < threads; i++)
+    {
+      m_workers.emplace_back(&CpuSandpile::work, this, i, std::cref(initialSand));
+    }
+    // Wait for every band to be allocated and filled before initialSand goes out of scope
+    m_frameBarrier.arriveAndWait();
+    if (m_failed)
+    {
+      m_log.fatal() << "Error allocating sandpile bands. ";
+      return;
+    }
+
+    m_log.info() << threads << " workers over " << topology.nodes().size()
+      << (topology.isFake() ? " fake" : "") << " NUMA nodes, tile width " << m_config.tileWidth
+      << ", block depth " << m_config.blockDepth;
+  }
+
+  CpuSandpile::~CpuSandpile()
+  {
+    m_stopping = true;
+    m_frameBarrier.arriveAndWait();
+    for (std::thread& worker : m_workers)
+    {
+      worker.join();
+    }
+  }
+
+  void CpuSandpile::step(size_t passes)
+  {
+    m_pendingPasses = passes;
+    m_frameBarrier.arriveAndWait();
+    m_frameBarrier.arriveAndWait();
+    m_current = (m_current + passes) % 2;
+  }
+
+  void CpuSandpile::read(std::vector<uint32_t>& cells) const
+  {
+    cells.resize(m_dim * m_dim);
+    for (const Band& band : m_bands)
+    {
+      for (size_t row = 0; row < band.rows; row++)
+      {
+        const uint32_t* pSrc = band.buffers[m_current] + (row + m_config.blockDepth) * stride() + 1;
+        std::copy(pSrc, pSrc + m_dim, &cells[(band.firstRow + row) * m_dim]);
+      }
+    }
+  }
+
+  void CpuSandpile::work(size_t index, const std::vector<uint32_t>& initialSand)
+  {
+    Band& band = m_bands[index];
+    if (!m_topology.pin(band.placement))
+    {
+      m_log.warning() << "Could not pin worker " << index << " to processor "
+        << band.placement.processor.group << ":" << int(band.placement.processor.number);
+    }
+
+    // Allocating and filling the band from the pinned thread places it on the local node by first
+    // touch even when explicit binding is unavailable
+    const size_t halo = m_config.blockDepth;
+    const size_t bufferRows = band.rows + 2 * halo;
+    size_t bytes = bufferRows * stride() * sizeof(uint32_t);
+    bool allocated = true;
+    for (uint32_t*& pBuffer : band.buffers)
+    {
+      pBuffer = static_cast<uint32_t*>(m_topology.allocate(bytes, band.placement.node));
+      allocated = allocated && pBuffer;
+    }
+
+    if (allocated)
+    {
+      for (uint32_t* pBuffer : band.buffers)
+      {
+        memset(pBuffer, 0, bytes);
+      }
+      for (size_t row = 0; row < band.rows; row++)
+      {
+        const uint32_t* pSrc = &initialSand[(band.firstRow + row) * m_dim];
+        std::copy(pSrc, pSrc + m_dim, band.buffers[m_current] + (row + halo) * stride() + 1);
+      }
+    }
+    else
+    {
+      m_log.error() << "Error allocating " << bytes << " bytes for worker " << index << ". ";
+      for (uint32_t*& pBuffer : band.buffers)
+      {
+        Topology::release(pBuffer);
+        pBuffer = nullptr;
+      }
+      m_failed = true;
+    }
+    // Arrive even on failure so the constructor can report it and the destructor can still stop us
+    m_frameBarrier.arriveAndWait();
+
+    for (;;)
+    {
+      m_frameBarrier.arriveAndWait();
+      if (m_stopping)
+      {
+        break;
+      }
+
+      // Halo rows outside the grid are never computed, so they stay zero
+      const size_t top = index == 0 ? halo : 0;
+      const size_t bottom = index + 1 == m_bands.size() ? halo + band.rows : bufferRows;
+      size_t current = m_current;
+      for (size_t pass = 0; pass < m_pendingPasses;)
+      {
+        size_t depth = std::min(halo, m_pendingPasses - pass);
+        exchangeHalos(index, current);
+        // A single pass only writes the other buffer, but deeper blocks come back around to
+        // the one neighbours are still copying from
+        if (depth > 1)
+        {
+          m_passBarrier.arriveAndWait();
+        }
+
+        // Each pass leaves one less valid halo row on either side
+        for (size_t i = 0; i < depth; i++)
+        {
+          sweep(index, current, std::max(top, i + 1), std::min(bottom, bufferRows - i - 1));
+          current = 1 - current;
+        }
+        m_passBarrier.arriveAndWait();
+        pass += depth;
+      }
+      m_frameBarrier.arriveAndWait();
+    }
+
+    for (uint32_t* pBuffer : band.buffers)
+    {
+      Topology::release(pBuffer);
+    }
+  }
+
+  void CpuSandpile::exchangeHalos(size_t index, size_t current)
+  {
+    Band& band = m_bands[index];
+    const size_t halo = m_config.blockDepth;
+    const size_t bytes = halo * stride() * sizeof(uint32_t);
+    if (index > 0)
+    {
+      const Band& above = m_bands[index - 1];
+      memcpy(band.buffers[current], above.buffers[current] + above.rows * stride(), bytes);
+    }
+    if (index + 1 < m_bands.size())
+    {
+      const Band& below = m_bands[index + 1];
+      memcpy(band.buffers[current] + (halo + band.rows) * stride(), below.buffers[current] + halo * stride(), bytes);
+    }
+  }
+
+  void CpuSandpile::sweep(size_t index, size_t current, size_t firstRow, size_t lastRow)
+  {
+    const Band& band = m_bands[index];
+    const uint32_t* pSrc = band.buffers[current];
+    uint32_t* pDst = band.buffers[1 - current];
+    for (size_t tile = 1; tile <= m_dim; tile += m_config.tileWidth)
+    {
+      const size_t tileEnd = std::min(tile + m_config.tileWidth, m_dim + 1);
+      for (size_t y = firstRow; y < lastRow; y++)
+      {
+        const uint32_t* up = pSrc + (y - 1) * stride();
+        const uint32_t* mid = pSrc + y * stride();
+        const uint32_t* down = pSrc + (y + 1) * stride();
+        uint32_t* out = pDst + y * stride();
+        for (size_t x = tile; x < tileEnd; x++)
+        {
+          uint32_t inc = uint32_t(up[x - 1] >= 8u) + uint32_t(up[x] >= 8u) + uint32_t(up[x + 1] >= 8u)
+            + uint32_t(mid[x - 1] >= 8u) + uint32_t(mid[x + 1] >= 8u)
+            + uint32_t(down[x - 1] >= 8u) + uint32_t(down[x] >= 8u) + uint32_t(down[x + 1] >= 8u);
+          out[x] = mid[x] + inc - 8u * uint32_t(mid[x] >= 8u);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "log.h"
+#include "topology.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sandbox
+{
+  class Barrier
+  {
+  public:
+    explicit Barrier(size_t count): m_count(count) {}
+
+    void arriveAndWait();
+
+  private:
+    const size_t m_count;
+    size_t m_arrived = 0;
+    size_t m_generation = 0;
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+  };
+
+  // CPU port of sandpile.fs.hlsl. The grid is cut into horizontal bands, one per worker. Each
+  // worker is pinned by the topology and allocates and first touches its own band, so the only
+  // memory it reads from another node is its neighbours' edge rows during the halo exchange.
+  class CpuSandpile
+  {
+  public:
+    struct Config
+    {
+      size_t threads;
+      // Columns swept per tile within a band
+      size_t tileWidth;
+      // Passes run between halo exchanges. Bands keep this many halo rows on each side and
+      // recompute the shrinking halo each pass instead of synchronising.
+      size_t blockDepth;
+    };
+
+    static Config defaultConfig(const Topology& topology, size_t dim);
+
+    CpuSandpile(const log::Target& logTarget, const Topology& topology, size_t dim,
+      const std::vector<uint32_t>& initialSand, const Config& config);
+    CpuSandpile(const CpuSandpile&) = delete;
+    ~CpuSandpile();
+
+    CpuSandpile& operator=(const CpuSandpile&) = delete;
+
+    size_t dim() const { return m_dim; }
+    // The configuration actually in use, after clamping to the grid
+    const Config& config() const { return m_config; }
+    // Set when a worker couldn't allocate its band. A failed sandpile must not be stepped.
+    bool failed() const { return m_failed; }
+
+    // Runs the given number of passes across all workers and returns once they are done.
+    void step(size_t passes);
+    // Copies the grid out. Only valid between steps.
+    void read(std::vector<uint32_t>& cells) const;
+
+  private:
+    // Rows are padded with a zero column on each side and blockDepth halo rows above and below.
+    // Halo rows outside the grid stay zero, which matches the shader's out of bounds loads.
+    struct Band
+    {
+      size_t firstRow;
+      size_t rows;
+      Placement placement;
+      uint32_t* buffers[2];
+    };
+
+    void work(size_t index, const std::vector<uint32_t>& initialSand);
+    void exchangeHalos(size_t index, size_t current);
+    void sweep(size_t index, size_t current, size_t firstRow, size_t lastRow);
+
+    size_t stride() const { return m_dim + 2; }
+
+    Logger m_log;
+    const Topology& m_topology;
+    const size_t m_dim;
+    Config m_config;
+    std::vector<Band> m_bands;
+    size_t m_current = 0;
+    size_t m_pendingPasses = 0;
+    bool m_stopping = false;
+    std::atomic<bool> m_failed { false };
+    Barrier m_frameBarrier;
+    Barrier m_passBarrier;
+    std::vector<std::thread> m_workers;
+  };
+}
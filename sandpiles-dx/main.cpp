@@ -1,9 +1,16 @@
+#include "cpu-sandpile.h"
 #include "log.h"
+#include "query-server.h"
+#include "snapshot.h"
+#include "topology.h"
+#include "tuner.h"
 #include "windows-util.h"
 
 #include <d3dcompiler.h>
 #include <d3d11.h>
+#include <cstdlib>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <thread>
 
@@ -28,12 +35,41 @@ LRESULT CALLBACK windowsMessageCallback(HWND hWindow, UINT message,
   }
 }
 
-int main()
+int main(int argc, char** argv)
 {
   using namespace sandbox;
   WindowsConsole console;
   Logger log(console, "Main");
 
+  bool useCpu = false;
+  bool tune = false;
+  size_t cpuThreads = 0;
+  size_t fakeNumaNodes = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg(argv[i]);
+    if (arg == "--cpu")
+    {
+      useCpu = true;
+    }
+    else if (arg == "--tune")
+    {
+      tune = true;
+    }
+    else if (arg.compare(0, 10, "--threads=") == 0)
+    {
+      cpuThreads = std::strtoul(arg.c_str() + 10, nullptr, 10);
+    }
+    else if (arg.compare(0, 12, "--fake-numa=") == 0)
+    {
+      fakeNumaNodes = std::strtoul(arg.c_str() + 12, nullptr, 10);
+    }
+    else
+    {
+      log.warning() << "Ignoring unknown argument " << arg;
+    }
+  }
+
   HINSTANCE hInstance = GetModuleHandle(NULL);
 
   log.verbose() << "Registering window class... ";
@@ -246,6 +282,18 @@ int main()
     }
   }
 
+  D3D11_TEXTURE2D_DESC snapshotTexDesc = sandTexDesc;
+  snapshotTexDesc.Usage = D3D11_USAGE_STAGING;
+  snapshotTexDesc.BindFlags = 0;
+  snapshotTexDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+
+  ID3D11Texture2D* snapshotTex;
+  if (FAILED(pDevice->CreateTexture2D(&snapshotTexDesc, NULL, &snapshotTex)))
+  {
+    log.fatal() << "Error creating snapshot staging texture. ";
+    return 0;
+  }
+
   D3D11_SAMPLER_DESC samplerDesc;
   samplerDesc.Filter = D3D11_FILTER_MIN_LINEAR_MAG_POINT_MIP_LINEAR;
   samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_BORDER;
@@ -456,6 +504,85 @@ int main()
 
   pContext->VSSetShader(pVertexShader, nullptr, 0);
 
+  size_t pingPongIndex = 0;
+  auto drawSandPasses = [&](size_t count)
+  {
+    for (size_t i = 0; i < count; i++) {
+      pContext->RSSetViewports(1, &sandpileViewport);
+
+      pContext->PSSetShaderResources(0, 1, &nullSrv);
+      pContext->OMSetRenderTargets(1, &sandFbo[pingPongIndex], nullptr);
+      pContext->PSSetShader(pSandpileShader, nullptr, 0);
+      pContext->PSSetShaderResources(0, 1, &sandTexSrv[1 - pingPongIndex]);
+      pContext->Draw(6, 0);
+      pingPongIndex = (pingPongIndex + 1) % 2;
+    }
+  };
+
+  Topology topology = fakeNumaNodes > 0 ? Topology::fake(fakeNumaNodes) : Topology::discover();
+  ProfileCache profiles(console, ProfileCache::hostPath());
+  const std::string profileKey = (useCpu ? "cpu-" : "gpu-") + std::to_string(dim);
+  TuningProfile profile { CpuSandpile::defaultConfig(topology, dim), useCpu ? 100u : 10'000u };
+  if (tune)
+  {
+    Tuner tuner(console);
+    if (useCpu)
+    {
+      profile = tuner.tuneCpu(topology, dim, sandData);
+    }
+    else
+    {
+      D3D11_QUERY_DESC flushQueryDesc { D3D11_QUERY_EVENT, 0 };
+      ID3D11Query* pFlushQuery;
+      if (FAILED(pDevice->CreateQuery(&flushQueryDesc, &pFlushQuery)))
+      {
+        log.fatal() << "Error creating tuning query. ";
+        return 0;
+      }
+
+      double rate = tuner.measureRate([&](size_t passes)
+      {
+        drawSandPasses(passes);
+        pContext->End(pFlushQuery);
+        while (pContext->GetData(pFlushQuery, nullptr, 0, 0) == S_FALSE) {}
+      });
+      pFlushQuery->Release();
+      profile.passesPerFrame = tuner.passesPerFrame(rate);
+      log.info() << "Picked " << profile.passesPerFrame << " passes per frame at " << rate << " passes/s";
+
+      // Probing advanced the simulation, so start over from the initial pile
+      for (ID3D11Texture2D* pTex : sandTex)
+      {
+        pContext->UpdateSubresource(pTex, 0, nullptr, sandData.data(), dim * sizeof(unsigned int), 0);
+      }
+    }
+
+    if (!profiles.save(profileKey, profile))
+    {
+      log.error() << "Error saving tuning profile to " << profiles.path();
+    }
+  }
+  else if (profiles.load(profileKey, profile))
+  {
+    log.info() << "Using tuning profile " << profileKey << " from " << profiles.path();
+  }
+
+  if (cpuThreads > 0)
+  {
+    profile.cpu.threads = cpuThreads;
+  }
+
+  std::unique_ptr<CpuSandpile> pCpuSandpile;
+  if (useCpu)
+  {
+    pCpuSandpile = std::make_unique<CpuSandpile>(console, topology, dim, sandData, profile.cpu);
+    if (pCpuSandpile->failed())
+    {
+      return 0;
+    }
+  }
+  const size_t passesPerFrame = profile.passesPerFrame;
+
   std::chrono::high_resolution_clock::time_point now;
   std::chrono::high_resolution_clock::time_point then;
   std::chrono::duration<float> avg = std::chrono::seconds(0);
@@ -463,8 +590,13 @@ int main()
   size_t frames = 0;
   std::chrono::duration<float> logTimer = std::chrono::seconds(0);
 
+  SnapshotStore snapshots;
+  QueryServer queryServer(console, snapshots);
+  bool snapshotPending = false;
+  uint64_t snapshotEpoch = 0;
+  uint64_t passes = 0;
+
   bool running = true;
-  size_t pingPongIndex = 0;
   MSG message;
   then = std::chrono::high_resolution_clock::now();
   while (running) {
@@ -488,15 +620,53 @@ int main()
       }
 
       // ======== Sand pass ========
-      for (size_t i = 0; i < 10'000; i++) {
+      if (pCpuSandpile)
+      {
+        pCpuSandpile->step(passesPerFrame);
+        pCpuSandpile->read(sandData);
         pContext->RSSetViewports(1, &sandpileViewport);
+        pContext->UpdateSubresource(sandTex[pingPongIndex], 0, nullptr, sandData.data(), dim * sizeof(uint32_t), 0);
+      }
+      else
+      {
+        drawSandPasses(passesPerFrame);
+      }
+      passes += passesPerFrame;
+
+      // ======== Snapshot readback ========
+      if (pCpuSandpile)
+      {
+        snapshots.publish(std::make_shared<Snapshot>(dim, passes, sandData));
+      }
+      else if (snapshotPending)
+      {
+        // Never wait on the GPU here: if last frame's copy hasn't landed yet, try again next frame
+        D3D11_MAPPED_SUBRESOURCE mapped;
+        HRESULT result = pContext->Map(snapshotTex, 0, D3D11_MAP_READ, D3D11_MAP_FLAG_DO_NOT_WAIT, &mapped);
+        if (SUCCEEDED(result))
+        {
+          std::vector<uint32_t> cells(dim * dim);
+          for (size_t row = 0; row < dim; row++)
+          {
+            const char* src = reinterpret_cast<const char*>(mapped.pData) + row * mapped.RowPitch;
+            memcpy(&cells[row * dim], src, dim * sizeof(uint32_t));
+          }
+          pContext->Unmap(snapshotTex, 0);
+          snapshots.publish(std::make_shared<Snapshot>(dim, snapshotEpoch, std::move(cells)));
+          snapshotPending = false;
+        }
+        else if (result != DXGI_ERROR_WAS_STILL_DRAWING)
+        {
+          log.error() << "Error mapping snapshot staging texture. ";
+          snapshotPending = false;
+        }
+      }
 
-        pContext->PSSetShaderResources(0, 1, &nullSrv);
-        pContext->OMSetRenderTargets(1, &sandFbo[pingPongIndex], nullptr);
-        pContext->PSSetShader(pSandpileShader, nullptr, 0);
-        pContext->PSSetShaderResources(0, 1, &sandTexSrv[1 - pingPongIndex]);
-        pContext->Draw(6, 0);
-        pingPongIndex = (pingPongIndex + 1) % 2;
+      if (!pCpuSandpile && !snapshotPending)
+      {
+        pContext->CopyResource(snapshotTex, sandTex[1 - pingPongIndex]);
+        snapshotEpoch = passes;
+        snapshotPending = true;
       }
 
       // ======== Colorize pass ========
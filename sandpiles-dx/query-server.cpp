@@ -0,0 +1,210 @@
+#include "query-server.h"
+#include "windows-util.h"
+
+#include <vector>
+
+namespace sandbox
+{
+  constexpr DWORD QueryServer::idleTimeout;
+
+  namespace
+  {
+    void appendRows(std::ostringstream& out, const std::vector<uint32_t>& cells, size_t width)
+    {
+      for (size_t i = 0; i < cells.size(); i++)
+      {
+        out << cells[i] << ((i + 1) % width == 0 ? '\n' : ' ');
+      }
+    }
+  }
+
+  QueryServer::QueryServer(const log::Target& logTarget, const SnapshotStore& store, std::string pipeName):
+    m_log(logTarget, "Query"), m_store(store), m_pipeName(std::move(pipeName)),
+    m_hStopEvent(CreateEvent(NULL, TRUE, FALSE, NULL)), m_thread(&QueryServer::run, this) {}
+
+  QueryServer::~QueryServer()
+  {
+    SetEvent(m_hStopEvent);
+    m_thread.join();
+    CloseHandle(m_hStopEvent);
+  }
+
+  void QueryServer::run()
+  {
+    OVERLAPPED overlapped;
+    ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    m_log.info() << "Listening on " << m_pipeName;
+    HANDLE hPipe = createInstance(true);
+    while (hPipe != INVALID_HANDLE_VALUE)
+    {
+      DWORD bytes;
+      bool connected = ConnectNamedPipe(hPipe, &overlapped) || GetLastError() == ERROR_PIPE_CONNECTED;
+      if (!connected && GetLastError() == ERROR_IO_PENDING)
+      {
+        connected = finishIo(hPipe, overlapped, bytes, INFINITE);
+      }
+
+      if (WaitForSingleObject(m_hStopEvent, 0) == WAIT_OBJECT_0)
+      {
+        CloseHandle(hPipe);
+        break;
+      }
+
+      if (!connected)
+      {
+        DisconnectNamedPipe(hPipe);
+        CloseHandle(hPipe);
+        hPipe = createInstance(false);
+        continue;
+      }
+
+      // Put the next instance up before handing this one off, so there is always one listening
+      HANDLE hNext = createInstance(false);
+      m_clients.remove_if([](Client& client)
+      {
+        if (!client.done)
+        {
+          return false;
+        }
+        client.thread.join();
+        return true;
+      });
+      m_clients.emplace_back();
+      Client& client = m_clients.back();
+      client.done = false;
+      client.thread = std::thread(&QueryServer::serveClient, this, hPipe, std::ref(client.done));
+      hPipe = hNext;
+    }
+
+    for (Client& client : m_clients)
+    {
+      client.thread.join();
+    }
+    CloseHandle(overlapped.hEvent);
+  }
+
+  HANDLE QueryServer::createInstance(bool first) const
+  {
+    // Claiming the first instance keeps a second copy of the app from quietly sharing the name
+    HANDLE hPipe = CreateNamedPipe(m_pipeName.c_str(),
+      PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+      PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+      PIPE_UNLIMITED_INSTANCES, 1 << 16, 1 << 12, 0, NULL);
+    if (hPipe == INVALID_HANDLE_VALUE && first)
+    {
+      m_log.error() << "Could not claim " << m_pipeName << ", is another copy already running? "
+        << WindowsError::last();
+    }
+    else if (hPipe == INVALID_HANDLE_VALUE)
+    {
+      m_log.error() << "Error creating pipe: " << WindowsError::last();
+    }
+    return hPipe;
+  }
+
+  void QueryServer::serveClient(HANDLE hPipe, std::atomic<bool>& done) const
+  {
+    OVERLAPPED overlapped;
+    ZeroMemory(&overlapped, sizeof(OVERLAPPED));
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    std::string pending;
+    char buffer[1024];
+    DWORD bytes;
+    bool open = true;
+    while (open)
+    {
+      if ((!ReadFile(hPipe, buffer, sizeof(buffer), NULL, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+        || !finishIo(hPipe, overlapped, bytes, idleTimeout) || bytes == 0)
+      {
+        break;
+      }
+      pending.append(buffer, bytes);
+
+      size_t newline;
+      while (open && (newline = pending.find('\n')) != std::string::npos)
+      {
+        std::string response = handleRequest(pending.substr(0, newline));
+        pending.erase(0, newline + 1);
+
+        for (size_t written = 0; open && written < response.size(); written += bytes)
+        {
+          open = (WriteFile(hPipe, response.data() + written, static_cast<DWORD>(response.size() - written), NULL, &overlapped)
+            || GetLastError() == ERROR_IO_PENDING) && finishIo(hPipe, overlapped, bytes, idleTimeout);
+        }
+      }
+    }
+
+    DisconnectNamedPipe(hPipe);
+    CloseHandle(hPipe);
+    CloseHandle(overlapped.hEvent);
+    done = true;
+  }
+
+  std::string QueryServer::handleRequest(const std::string& request) const
+  {
+    std::shared_ptr<const Snapshot> snapshot = m_store.latest();
+    if (!snapshot)
+    {
+      return "error no snapshot yet\n";
+    }
+
+    std::istringstream in(request);
+    std::ostringstream out;
+    std::string command;
+    in >> command;
+    if (command == "stats")
+    {
+      const SnapshotStats& stats = snapshot->stats();
+      out << "epoch " << snapshot->epoch() << " dim " << snapshot->dim() << " total " << stats.totalSand
+        << " max " << stats.maxHeight << " unstable " << stats.unstableCells << " histogram";
+      for (size_t count : stats.histogram)
+      {
+        out << ' ' << count;
+      }
+      out << '\n';
+    }
+    else if (command == "overview")
+    {
+      size_t size;
+      if (!(in >> size) || size == 0 || size > snapshot->dim())
+      {
+        return "error overview size must be between 1 and the grid size\n";
+      }
+      out << "epoch " << snapshot->epoch() << " width " << size << " height " << size << '\n';
+      appendRows(out, snapshot->overview(size), size);
+    }
+    else if (command == "region")
+    {
+      size_t x, y, width, height;
+      if (!(in >> x >> y >> width >> height) || width == 0 || height == 0
+        || x >= snapshot->dim() || width > snapshot->dim() - x
+        || y >= snapshot->dim() || height > snapshot->dim() - y)
+      {
+        return "error region must be non-empty and lie within the grid\n";
+      }
+      out << "epoch " << snapshot->epoch() << " x " << x << " y " << y
+        << " width " << width << " height " << height << '\n';
+      appendRows(out, snapshot->region(x, y, width, height), width);
+    }
+    else
+    {
+      return "error unknown command '" + command + "'\n";
+    }
+    return out.str();
+  }
+
+  bool QueryServer::finishIo(HANDLE hPipe, OVERLAPPED& overlapped, DWORD& bytes, DWORD timeout) const
+  {
+    HANDLE handles[2] { overlapped.hEvent, m_hStopEvent };
+    if (WaitForMultipleObjects(2, handles, FALSE, timeout) != WAIT_OBJECT_0)
+    {
+      CancelIo(hPipe);
+      GetOverlappedResult(hPipe, &overlapped, &bytes, TRUE);
+      return false;
+    }
+    return GetOverlappedResult(hPipe, &overlapped, &bytes, FALSE) != FALSE;
+  }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "log.h"
+#include "snapshot.h"
+
+#include <Windows.h>
+#include <atomic>
+#include <list>
+#include <string>
+#include <thread>
+
+namespace sandbox
+{
+  // Answers monitoring queries against the latest published snapshot over a named pipe.
+  // Each request is a single line, and each response is a header line followed by any rows
+  // of space separated values:
+  //   stats                    -> epoch E dim D total T max M unstable U histogram H0 .. H7
+  //   overview SIZE            -> epoch E width SIZE height SIZE, then SIZE rows
+  //   region X Y WIDTH HEIGHT  -> epoch E x X y Y width WIDTH height HEIGHT, then HEIGHT rows
+  // Every client is served on its own thread, and clients that stall for idleTimeout are dropped.
+  class QueryServer
+  {
+  public:
+    static constexpr const char* defaultPipeName = "\\\\.\\pipe\\sandpiles";
+    static constexpr DWORD idleTimeout = 30'000;
+
+    QueryServer(const log::Target& logTarget, const SnapshotStore& store, std::string pipeName = defaultPipeName);
+    QueryServer(const QueryServer&) = delete;
+    ~QueryServer();
+
+    QueryServer& operator=(const QueryServer&) = delete;
+
+  private:
+    struct Client
+    {
+      std::thread thread;
+      std::atomic<bool> done;
+    };
+
+    void run();
+    HANDLE createInstance(bool first) const;
+    void serveClient(HANDLE hPipe, std::atomic<bool>& done) const;
+    std::string handleRequest(const std::string& request) const;
+    // Waits for an overlapped call on hPipe, cancelling it if it takes longer than timeout
+    // milliseconds or the server is stopping.
+    bool finishIo(HANDLE hPipe, OVERLAPPED& overlapped, DWORD& bytes, DWORD timeout) const;
+
+    Logger m_log;
+    const SnapshotStore& m_store;
+    const std::string m_pipeName;
+    HANDLE m_hStopEvent;
+    // Only touched by the listening thread
+    std::list<Client> m_clients;
+    std::thread m_thread;
+  };
+}
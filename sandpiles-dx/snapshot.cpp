@@ -0,0 +1,63 @@
+#include "snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace sandbox
+{
+  Snapshot::Snapshot(size_t dim, uint64_t epoch, std::vector<uint32_t> cells):
+    m_dim(dim), m_epoch(epoch), m_cells(std::move(cells)), m_stats() {}
+
+  std::vector<uint32_t> Snapshot::overview(size_t size) const
+  {
+    size = std::max<size_t>(1, std::min(size, m_dim));
+    std::vector<uint32_t> result(size * size, 0);
+    for (size_t y = 0; y < m_dim; y++)
+    {
+      size_t row = y * size / m_dim;
+      for (size_t x = 0; x < m_dim; x++)
+      {
+        uint32_t& block = result[row * size + x * size / m_dim];
+        block = std::max(block, at(x, y));
+      }
+    }
+    return result;
+  }
+
+  std::vector<uint32_t> Snapshot::region(size_t x, size_t y, size_t width, size_t height) const
+  {
+    std::vector<uint32_t> result;
+    result.reserve(width * height);
+    for (size_t row = y; row < y + height; row++)
+    {
+      auto begin = m_cells.begin() + row * m_dim + x;
+      result.insert(result.end(), begin, begin + width);
+    }
+    return result;
+  }
+
+  const SnapshotStats& Snapshot::stats() const
+  {
+    std::call_once(m_statsOnce, [this]
+    {
+      for (uint32_t sand : m_cells)
+      {
+        m_stats.totalSand += sand;
+        m_stats.maxHeight = std::max(m_stats.maxHeight, sand);
+        m_stats.unstableCells += sand >= 8u;
+        m_stats.histogram[std::min(7u, sand)]++;
+      }
+    });
+    return m_stats;
+  }
+
+  void SnapshotStore::publish(std::shared_ptr<const Snapshot> snapshot)
+  {
+    std::atomic_store(&m_latest, std::move(snapshot));
+  }
+
+  std::shared_ptr<const Snapshot> SnapshotStore::latest() const
+  {
+    return std::atomic_load(&m_latest);
+  }
+}
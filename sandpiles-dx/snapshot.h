@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace sandbox
+{
+  struct SnapshotStats
+  {
+    uint64_t totalSand;
+    uint32_t maxHeight;
+    size_t unstableCells;
+    // Cell counts per colorize bucket, i.e. min(7, height)
+    size_t histogram[8];
+  };
+
+  // Immutable copy of the sand grid as of a given number of completed passes.
+  class Snapshot
+  {
+  public:
+    Snapshot(size_t dim, uint64_t epoch, std::vector<uint32_t> cells);
+
+    size_t dim() const { return m_dim; }
+    uint64_t epoch() const { return m_epoch; }
+    uint32_t at(size_t x, size_t y) const { return m_cells[y * m_dim + x]; }
+
+    // Downsamples the grid to size x size cells, keeping the tallest pile in each block.
+    std::vector<uint32_t> overview(size_t size) const;
+    // Full resolution copy of a rectangle, which must lie within the grid.
+    std::vector<uint32_t> region(size_t x, size_t y, size_t width, size_t height) const;
+    // Computed on first use and cached, so publishing a snapshot stays cheap.
+    const SnapshotStats& stats() const;
+
+  private:
+    const size_t m_dim;
+    const uint64_t m_epoch;
+    const std::vector<uint32_t> m_cells;
+
+    mutable std::once_flag m_statsOnce;
+    mutable SnapshotStats m_stats;
+  };
+
+  // Hands out the most recently published snapshot. Publishing and acquiring only hold a short
+  // lock around the pointer swap, never while a snapshot is copied or read, and readers keep
+  // whatever snapshot they acquired alive for as long as they hold it.
+  class SnapshotStore
+  {
+  public:
+    void publish(std::shared_ptr<const Snapshot> snapshot);
+    std::shared_ptr<const Snapshot> latest() const;
+
+  private:
+    std::shared_ptr<const Snapshot> m_latest;
+  };
+}
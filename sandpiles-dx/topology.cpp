@@ -0,0 +1,127 @@
+#include "topology.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace sandbox
+{
+  Topology Topology::discover()
+  {
+    Topology topology;
+
+    DWORD size = 0;
+    GetLogicalProcessorInformationEx(RelationNumaNode, nullptr, &size);
+    std::vector<char> buffer(size);
+    if (size > 0 && GetLogicalProcessorInformationEx(RelationNumaNode,
+      reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data()), &size))
+    {
+      for (DWORD offset = 0; offset < size;)
+      {
+        const auto* pInfo = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(&buffer[offset]);
+        NumaNode node;
+        node.id = pInfo->NumaNode.NodeNumber;
+        for (BYTE bit = 0; bit < sizeof(KAFFINITY) * 8; bit++)
+        {
+          if ((pInfo->NumaNode.GroupMask.Mask >> bit) & 1)
+          {
+            node.processors.push_back({ pInfo->NumaNode.GroupMask.Group, bit });
+          }
+        }
+        if (!node.processors.empty())
+        {
+          topology.m_nodes.push_back(std::move(node));
+        }
+        offset += pInfo->Size;
+      }
+    }
+
+    if (topology.m_nodes.empty())
+    {
+      NumaNode node { 0, {} };
+      size_t count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), sizeof(KAFFINITY) * 8);
+      for (size_t i = 0; i < count; i++)
+      {
+        node.processors.push_back({ 0, static_cast<BYTE>(i) });
+      }
+      topology.m_nodes.push_back(std::move(node));
+    }
+    return topology;
+  }
+
+  Topology Topology::fake(size_t nodeCount)
+  {
+    Topology real = discover();
+    std::vector<Processor> processors;
+    for (const NumaNode& node : real.nodes())
+    {
+      processors.insert(processors.end(), node.processors.begin(), node.processors.end());
+    }
+
+    Topology topology;
+    topology.m_fake = true;
+    nodeCount = std::max<size_t>(1, nodeCount);
+    for (size_t i = 0; i < nodeCount; i++)
+    {
+      NumaNode node { static_cast<unsigned>(i), {} };
+      size_t begin = i * processors.size() / nodeCount;
+      size_t end = (i + 1) * processors.size() / nodeCount;
+      if (begin == end)
+      {
+        node.processors.push_back(processors[i % processors.size()]);
+      }
+      node.processors.insert(node.processors.end(), processors.begin() + begin, processors.begin() + end);
+      topology.m_nodes.push_back(std::move(node));
+    }
+    return topology;
+  }
+
+  size_t Topology::processorCount() const
+  {
+    size_t count = 0;
+    for (const NumaNode& node : m_nodes)
+    {
+      count += node.processors.size();
+    }
+    return count;
+  }
+
+  std::vector<Placement> Topology::place(size_t workers) const
+  {
+    std::vector<Placement> placements;
+    for (size_t i = 0; i < workers; i++)
+    {
+      size_t nodeIndex = i * m_nodes.size() / workers;
+      size_t firstOnNode = (nodeIndex * workers + m_nodes.size() - 1) / m_nodes.size();
+      const NumaNode& node = m_nodes[nodeIndex];
+      placements.push_back({ node.id, node.processors[(i - firstOnNode) % node.processors.size()] });
+    }
+    return placements;
+  }
+
+  bool Topology::pin(const Placement& placement) const
+  {
+    GROUP_AFFINITY affinity;
+    ZeroMemory(&affinity, sizeof(GROUP_AFFINITY));
+    affinity.Group = placement.processor.group;
+    affinity.Mask = KAFFINITY(1) << placement.processor.number;
+    return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != FALSE;
+  }
+
+  void* Topology::allocate(size_t bytes, unsigned node) const
+  {
+    if (m_fake)
+    {
+      return VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+    void* memory = VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+    return memory ? memory : VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+  }
+
+  void Topology::release(void* memory)
+  {
+    if (memory)
+    {
+      VirtualFree(memory, 0, MEM_RELEASE);
+    }
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Windows.h>
+#include <vector>
+
+namespace sandbox
+{
+  struct Processor
+  {
+    WORD group;
+    BYTE number;
+  };
+
+  struct NumaNode
+  {
+    unsigned id;
+    std::vector<Processor> processors;
+  };
+
+  // Where a worker thread runs and which node its memory should come from.
+  struct Placement
+  {
+    unsigned node;
+    Processor processor;
+  };
+
+  class Topology
+  {
+  public:
+    static Topology discover();
+    // Splits this machine's processors into nodeCount pretend nodes so placement can be exercised
+    // on single node machines. Memory then lands wherever it is first touched.
+    static Topology fake(size_t nodeCount);
+
+    const std::vector<NumaNode>& nodes() const { return m_nodes; }
+    bool isFake() const { return m_fake; }
+    size_t processorCount() const;
+
+    // Spreads workers over the nodes in contiguous runs, so neighbouring workers share a node
+    // wherever possible, then round robin over each node's processors.
+    std::vector<Placement> place(size_t workers) const;
+
+    // Pins the calling thread to the placement's processor.
+    bool pin(const Placement& placement) const;
+    // Commits zeroed memory bound to the given node, falling back to first touch placement when the
+    // node can't be honoured. Returns nullptr on failure.
+    void* allocate(size_t bytes, unsigned node) const;
+    static void release(void* memory);
+
+  private:
+    std::vector<NumaNode> m_nodes;
+    bool m_fake = false;
+  };
+}
@@ -0,0 +1,183 @@
+#include "tuner.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+
+namespace sandbox
+{
+  constexpr std::chrono::milliseconds Tuner::minProbeTime;
+  constexpr double Tuner::frameBudget;
+
+  std::string ProfileCache::hostPath()
+  {
+    char name[MAX_COMPUTERNAME_LENGTH + 1];
+    DWORD size = sizeof(name);
+    std::string host = GetComputerNameA(name, &size) ? std::string(name, size) : "unknown";
+    return "sandpiles-" + host + ".profile";
+  }
+
+  bool ProfileCache::load(const std::string& key, TuningProfile& profile) const
+  {
+    std::ifstream in(m_path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+      std::istringstream fields(line);
+      std::string name;
+      if (!(fields >> name) || name != key)
+      {
+        continue;
+      }
+
+      TuningProfile loaded = profile;
+      std::string field;
+      while (fields >> field)
+      {
+        size_t separator = field.find('=');
+        if (separator == std::string::npos)
+        {
+          continue;
+        }
+        std::string knob = field.substr(0, separator);
+        const char* text = field.c_str() + separator + 1;
+        char* end;
+        size_t value = std::strtoul(text, &end, 10);
+        // strtoul happily wraps negative numbers, so insist on digits only
+        if (*text < '0' || *text > '9' || *end != '\0' || value == 0)
+        {
+          m_log.warning() << "Ignoring tuning profile " << key << " in " << m_path << ", bad value " << field;
+          return false;
+        }
+
+        if (knob == "threads")
+        {
+          loaded.cpu.threads = value;
+        }
+        else if (knob == "tileWidth")
+        {
+          loaded.cpu.tileWidth = value;
+        }
+        else if (knob == "blockDepth")
+        {
+          loaded.cpu.blockDepth = value;
+        }
+        else if (knob == "passesPerFrame")
+        {
+          loaded.passesPerFrame = value;
+        }
+      }
+      profile = loaded;
+      return true;
+    }
+    return false;
+  }
+
+  bool ProfileCache::save(const std::string& key, const TuningProfile& profile) const
+  {
+    std::vector<std::string> lines;
+    {
+      std::ifstream in(m_path);
+      std::string line;
+      while (std::getline(in, line))
+      {
+        std::istringstream fields(line);
+        std::string name;
+        if (fields >> name && name != key)
+        {
+          lines.push_back(line);
+        }
+      }
+    }
+
+    std::ostringstream entry;
+    entry << key << " threads=" << profile.cpu.threads << " tileWidth=" << profile.cpu.tileWidth
+      << " blockDepth=" << profile.cpu.blockDepth << " passesPerFrame=" << profile.passesPerFrame;
+    lines.push_back(entry.str());
+
+    std::ofstream out(m_path, std::ios::out | std::ios::trunc);
+    for (const std::string& line : lines)
+    {
+      out << line << '\n';
+    }
+    return static_cast<bool>(out);
+  }
+
+  double Tuner::measureRate(const std::function<void(size_t)>& run) const
+  {
+    // Warm up caches, page mappings and drivers before timing anything
+    run(1);
+    for (size_t passes = 1;; passes *= 2)
+    {
+      auto start = std::chrono::high_resolution_clock::now();
+      run(passes);
+      std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+      if (elapsed >= minProbeTime)
+      {
+        return passes / elapsed.count();
+      }
+    }
+  }
+
+  size_t Tuner::passesPerFrame(double passesPerSecond) const
+  {
+    return std::max<size_t>(1, static_cast<size_t>(passesPerSecond * frameBudget));
+  }
+
+  TuningProfile Tuner::tuneCpu(const Topology& topology, size_t dim, const std::vector<uint32_t>& initialSand) const
+  {
+    CpuSandpile::Config best = CpuSandpile::defaultConfig(topology, dim);
+    double bestRate = 0.0;
+    auto probe = [&](CpuSandpile::Config config)
+    {
+      CpuSandpile sandpile(m_logTarget, topology, dim, initialSand, config);
+      if (sandpile.failed())
+      {
+        return;
+      }
+      double rate = measureRate([&](size_t passes) { sandpile.step(passes); });
+      const CpuSandpile::Config& used = sandpile.config();
+      m_log.verbose() << used.threads << " threads, tile width " << used.tileWidth << ", block depth "
+        << used.blockDepth << ": " << rate << " passes/s";
+      if (rate > bestRate)
+      {
+        best = used;
+        bestRate = rate;
+      }
+    };
+
+    std::vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < topology.processorCount(); threads *= 2)
+    {
+      threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(topology.processorCount());
+    for (size_t threads : threadCounts)
+    {
+      CpuSandpile::Config config = best;
+      config.threads = threads;
+      probe(config);
+    }
+
+    CpuSandpile::Config current = best;
+    for (size_t blockDepth : { 2, 4, 8, 16 })
+    {
+      CpuSandpile::Config config = current;
+      config.blockDepth = blockDepth;
+      probe(config);
+    }
+
+    current = best;
+    for (size_t tileWidth = 512; tileWidth >= 64 && tileWidth < dim; tileWidth /= 2)
+    {
+      CpuSandpile::Config config = current;
+      config.tileWidth = tileWidth;
+      probe(config);
+    }
+
+    TuningProfile profile { best, passesPerFrame(bestRate) };
+    m_log.info() << "Picked " << best.threads << " threads, tile width " << best.tileWidth << ", block depth "
+      << best.blockDepth << " at " << bestRate << " passes/s, " << profile.passesPerFrame << " passes per frame";
+    return profile;
+  }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "cpu-sandpile.h"
+#include "log.h"
+#include "topology.h"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace sandbox
+{
+  struct TuningProfile
+  {
+    CpuSandpile::Config cpu;
+    size_t passesPerFrame;
+  };
+
+  // Tuning profiles keyed by backend and grid size, one line each, in a file named after the host.
+  class ProfileCache
+  {
+  public:
+    static std::string hostPath();
+
+    ProfileCache(const log::Target& logTarget, std::string path): m_log(logTarget, "Tuner"), m_path(std::move(path)) {}
+
+    const std::string& path() const { return m_path; }
+
+    // Leaves profile untouched if there is no entry for key, or if the entry has a zero or
+    // unparseable value.
+    bool load(const std::string& key, TuningProfile& profile) const;
+    bool save(const std::string& key, const TuningProfile& profile) const;
+
+  private:
+    Logger m_log;
+    const std::string m_path;
+  };
+
+  class Tuner
+  {
+  public:
+    explicit Tuner(const log::Target& logTarget): m_logTarget(logTarget), m_log(logTarget, "Tuner") {}
+
+    // Calls run with doubling pass counts until a probe takes long enough to time reliably, and
+    // returns the passes per second it achieved.
+    double measureRate(const std::function<void(size_t)>& run) const;
+    // Enough passes to fill one frame at the measured rate.
+    size_t passesPerFrame(double passesPerSecond) const;
+    // Probes thread count, then block depth, then tile width, keeping the fastest of each before
+    // moving on to the next.
+    TuningProfile tuneCpu(const Topology& topology, size_t dim, const std::vector<uint32_t>& initialSand) const;
+
+  private:
+    static constexpr std::chrono::milliseconds minProbeTime { 50 };
+    static constexpr double frameBudget = 1.0 / 60.0;
+
+    const log::Target& m_logTarget;
+    Logger m_log;
+  };
+}